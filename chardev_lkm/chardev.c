@@ -3,7 +3,18 @@
 #include <linux/device.h>       /*  Header to support the kernel Driver Model */
 #include <linux/kernel.h>       /* Contains types, macros, functions for the kernel */
 #include <linux/fs.h>           /* Header for the Linux file system support */
+#include <linux/sysfs.h>        /* Required for the device attributes */
+#include <linux/wait.h>         /* Required for the flush barrier wait queue */
+#include <linux/smp.h>          /* Required for recording the producer CPU */
+#include <linux/topology.h>     /* Required for mapping a CPU to its NUMA node */
+#include <linux/jhash.h>        /* Required for hashing payloads in repeat suppression */
+#include <linux/slab.h>         /* Required for the per-file rate limiter state */
+#include <linux/spinlock.h>     /* Required for the message and token bucket locks */
+#include <linux/ktime.h>        /* Required for refilling the token buckets */
+#include <linux/math64.h>       /* Required for 64-bit division on 32-bit targets */
+#include <linux/sched/signal.h> /* Required for signal_pending() while throttled */
 #include <asm/uaccess.h>        /* Required for the copy to user function */
+#include "chardev.h"            /* The in-kernel producer API exported below */
 #define DEVICE_NAME "chardev" 	/* The device will appear at /dev/chardev using this value */
 #define CLASS_NAME "chard"      /* The device class -- this is a character device driver */
 
@@ -15,9 +26,61 @@ MODULE_VERSION("0.1");             				  /* A version number to inform users */
 static int major_num; 						 /* Stores the device number -- determined automatically */
 static char message[256] = {0};              /* Memory for the string that is passed from userspace */
 static short size_of_message;   			 /* Used to remember the size of the string stored */
+static short read_pos;                       /* How much of the message readers have already taken */
 static int open_num = 0; 					 /* Counts the number of times the device is opened */
 static struct class *chardev_class = NULL; 	 /* The device-driver class struct pointer */
 static struct device *chardev_device = NULL; /* The device-driver device struct pointer */
+static struct kernfs_node *queue_state_kn;   /* queue_state attribute, notified from atomic context */
+static DEFINE_SPINLOCK(chardev_lock);        /* Serializes message, size_of_message and read_pos; irq-safe for chardev_enqueue() */
+static DECLARE_WAIT_QUEUE_HEAD(flush_wait);  /* Writers sleeping in dev_fsync() until the message is read */
+static unsigned long write_seq;              /* Number of messages written, guarded by chardev_lock */
+static unsigned long read_seq;               /* write_seq of the last message copied out to a reader */
+#define PRODUCER_HISTORY 64                  /* Number of recent messages the producer CPU statistics cover */
+static int producer_ring[PRODUCER_HISTORY];  /* CPU of each recent message, indexed by write_seq */
+static char message_payload[256];            /* Raw copy of the payload held in message */
+static u32 message_hash;                     /* jhash of that payload */
+static size_t message_payload_len;           /* Length of that payload, before formatting */
+static size_t message_len;                   /* Length the producer asked to write, before truncation */
+static unsigned int message_repeats;         /* Number of times the held payload was written */
+
+static bool suppress_repeats;                /* Fold identical consecutive writes into one message */
+module_param(suppress_repeats, bool, 0644);
+MODULE_PARM_DESC(suppress_repeats, "Count repeats of the pending message instead of replacing it");
+
+/*
+ * Write rate limits, 0 means unlimited. Each limit allows a burst of one
+ * second's worth of traffic.
+ */
+static unsigned int device_msg_rate;
+module_param(device_msg_rate, uint, 0644);
+MODULE_PARM_DESC(device_msg_rate, "Messages per second accepted by the device");
+static unsigned int device_byte_rate;
+module_param(device_byte_rate, uint, 0644);
+MODULE_PARM_DESC(device_byte_rate, "Bytes per second accepted by the device");
+static unsigned int file_msg_rate;
+module_param(file_msg_rate, uint, 0644);
+MODULE_PARM_DESC(file_msg_rate, "Messages per second accepted from each open file");
+static unsigned int file_byte_rate;
+module_param(file_byte_rate, uint, 0644);
+MODULE_PARM_DESC(file_byte_rate, "Bytes per second accepted from each open file");
+
+/*
+ * Token bucket for the rate limits. Tokens are kept in rate * nanoseconds so
+ * refilling needs no division; one message costs NSEC_PER_SEC msg_tokens and
+ * one byte costs NSEC_PER_SEC byte_tokens.
+ */
+struct token_bucket {
+  spinlock_t lock;
+  u64 last;        /* ktime_get_ns() of the last refill */
+  u64 msg_tokens;
+  u64 byte_tokens;
+};
+
+static struct token_bucket device_bucket = {
+    .lock = __SPIN_LOCK_UNLOCKED(device_bucket.lock),
+};
+static atomic_long_t device_throttles = ATOMIC_LONG_INIT(0); /* Writes held back by the device limits */
+static atomic_long_t file_throttles = ATOMIC_LONG_INIT(0);   /* Writes held back by a per-file limit */
 
 /*
  * The prototype functions for the character driver
@@ -27,6 +90,14 @@ static int dev_open(struct inode *, struct file *);
 static int dev_release(struct inode *, struct file *);
 static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dev_write(struct file *, const char *, size_t, loff_t *);
+static int dev_fsync(struct file *, loff_t, loff_t, int);
+static ssize_t pending_show(struct device *, struct device_attribute *, char *);
+static ssize_t producer_cpus_show(struct device *, struct device_attribute *, char *);
+static ssize_t suggested_cpu_show(struct device *, struct device_attribute *, char *);
+static ssize_t suggested_node_show(struct device *, struct device_attribute *, char *);
+static ssize_t queue_state_show(struct device *, struct device_attribute *, char *);
+static ssize_t throttled_device_show(struct device *, struct device_attribute *, char *);
+static ssize_t throttled_file_show(struct device *, struct device_attribute *, char *);
 
 /*
  *  Devices are represented as file structure in the kernel. The file_operations
@@ -37,12 +108,47 @@ static ssize_t dev_write(struct file *, const char *, size_t, loff_t *);
  * write and release calls
  */
 static struct file_operations fops = {
+    .owner = THIS_MODULE, /* pin the module while a file is open or asleep in it */
     .open = dev_open,
     .read = dev_read,
     .write = dev_write,
+    .fsync = dev_fsync,
     .release = dev_release,
 };
 
+/*
+ *  Attributes exposed under /sys/class/chard/chardev/
+ *  pending  The message currently held by the device, shown without consuming
+ *           it so a stalled reader can be diagnosed from outside; root only,
+ *           like the device node itself
+ *  producer_cpus   One "cpu count" line per CPU that wrote any of the last
+ *                  PRODUCER_HISTORY (64) messages
+ *  suggested_cpu   The CPU that produced the most of those messages, -1 if none yet
+ *  suggested_node  The NUMA node of suggested_cpu, -1 if none yet
+ *  queue_state     "empty" or "pending"; pollable, notified on every change
+ *  throttled_device  Writes held back by device_msg_rate/device_byte_rate
+ *  throttled_file    Writes held back by file_msg_rate/file_byte_rate
+ */
+static DEVICE_ATTR_ADMIN_RO(pending);
+static DEVICE_ATTR_RO(producer_cpus);
+static DEVICE_ATTR_RO(suggested_cpu);
+static DEVICE_ATTR_RO(suggested_node);
+static DEVICE_ATTR_RO(queue_state);
+static DEVICE_ATTR_RO(throttled_device);
+static DEVICE_ATTR_RO(throttled_file);
+
+static struct attribute *chardev_attrs[] = {
+    &dev_attr_pending.attr,
+    &dev_attr_producer_cpus.attr,
+    &dev_attr_suggested_cpu.attr,
+    &dev_attr_suggested_node.attr,
+    &dev_attr_queue_state.attr,
+    &dev_attr_throttled_device.attr,
+    &dev_attr_throttled_file.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(chardev);
+
 /*
  *  The LKM initialization function
  *  The static keyword restricts the visibility of the function to within this C
@@ -71,9 +177,10 @@ static int __init chardev_init(void) {
   }
   printk(KERN_INFO "chardev: device class registered correctly\n");
 
-  /* Register the device driver */
-  chardev_device = device_create(chardev_class, NULL, MKDEV(major_num, 0), NULL,
-                                 DEVICE_NAME);
+  /* Register the device driver together with its sysfs attributes */
+  chardev_device = device_create_with_groups(chardev_class, NULL,
+                                             MKDEV(major_num, 0), NULL,
+                                             chardev_groups, DEVICE_NAME);
   if (IS_ERR(chardev_device)) {   /* Clean up if there is an error */
     class_destroy(chardev_class); /* Repeated code but the alternative is goto
                                      statements */
@@ -81,6 +188,16 @@ static int __init chardev_init(void) {
     printk(KERN_ALERT "Failed to create the device\n");
     return PTR_ERR(chardev_device);
   }
+
+  /* Look up queue_state once so it can be notified from atomic context */
+  queue_state_kn = sysfs_get_dirent(chardev_device->kobj.sd, "queue_state");
+  if (!queue_state_kn) {
+    device_destroy(chardev_class, MKDEV(major_num, 0));
+    class_destroy(chardev_class);
+    unregister_chrdev(major_num, DEVICE_NAME);
+    printk(KERN_ALERT "Failed to find the queue_state attribute\n");
+    return -ENOENT;
+  }
   printk(KERN_INFO "chardev: device class created correctly\n"); /* Made it! device was initialized */
   return 0;
 }
@@ -93,6 +210,7 @@ static int __init chardev_init(void) {
  * required.
  */
 static void __exit chardev_exit(void) {
+  sysfs_put(queue_state_kn);                          /* drop the queue_state reference */
   device_destroy(chardev_class, MKDEV(major_num, 0)); /* remove the device */
   class_unregister(chardev_class);           /* unregister the device class */
   class_destroy(chardev_class);              /* remove the device class */
@@ -102,11 +220,20 @@ static void __exit chardev_exit(void) {
 
 /*
  *  The device open function that is called each time the device is opened
- *  This will only increment the numberOpens counter in this case.
+ *  This increments the numberOpens counter and gives the file its own token
+ * bucket for the per-file rate limits.
  *  inodep A pointer to an inode object (defined in linux/fs.h)
  *  filep A pointer to a file object (defined in linux/fs.h)
  */
 static int dev_open(struct inode *inodep, struct file *filep) {
+  struct token_bucket *bucket;
+
+  bucket = kzalloc(sizeof(*bucket), GFP_KERNEL);
+  if (!bucket)
+    return -ENOMEM;
+  spin_lock_init(&bucket->lock);
+  filep->private_data = bucket;
+
   open_num++;
   printk(KERN_INFO "chardev: Device has been opened %d time(s)\n", open_num);
   return 0;
@@ -118,6 +245,9 @@ static int dev_open(struct inode *inodep, struct file *filep) {
  *  being sent from the device to the user. In this case is uses the
  * copy_to_user() function to
  *  send the buffer string to the user and captures any errors.
+ *  At most len bytes are returned per call; the rest of the message is left
+ * for the next read, and the message is consumed once all of it was read.
+ * Reading an empty device returns 0.
  *  filep A pointer to a file object (defined in linux/fs.h)
  *  buffer The pointer to the buffer to which this function writes the data
  *  len The length of the b
@@ -125,28 +255,224 @@ static int dev_open(struct inode *inodep, struct file *filep) {
  */
 static ssize_t dev_read(struct file *filep, char *buffer, size_t len,
                         loff_t *offset) {
+  char chunk[sizeof(message)];
+  unsigned long flags;
   int error_count = 0;
+  unsigned long seq;
+  short start, size;
+  size_t count;
+  bool consumed;
+
+  /*
+   * Reserve the bytes under the lock, then copy them out without it so a
+   * faulting user buffer cannot stall other readers and writers
+   */
+  spin_lock_irqsave(&chardev_lock, flags);
+  seq = write_seq;
+  start = read_pos;
+  size = size_of_message;
+  count = min_t(size_t, len, size - start);
+  memcpy(chunk, message + start, count);
+  read_pos += count;
+  consumed = size != 0 && read_pos == size;
+  if (consumed)
+    size_of_message = read_pos = 0; /* clear the position to the start */
+  spin_unlock_irqrestore(&chardev_lock, flags);
+
   /*
    * copy_to_user has the format ( * to, *from, size)
    * and returns 0 on success
    */
-  error_count = copy_to_user(buffer, message, size_of_message);
+  error_count = copy_to_user(buffer, chunk, count);
 
   if (error_count == 0) { /* if true then have success */
-    printk(KERN_INFO "chardev: Sent %d characters to the user\n", size_of_message);
-    return (size_of_message = 0); /* clear the position to the start and return 0 */
+    printk(KERN_INFO "chardev: Sent %zu characters to the user\n", count);
+    if (consumed) {
+      spin_lock_irqsave(&chardev_lock, flags);
+      if ((long)(seq - read_seq) > 0)
+        WRITE_ONCE(read_seq, seq);
+      spin_unlock_irqrestore(&chardev_lock, flags);
+      wake_up_interruptible(&flush_wait); /* release writers waiting in dev_fsync() */
+      sysfs_notify_dirent(queue_state_kn);
+    }
+    return count;
   } else {
+    /* hand the reservation back unless a writer or reader moved on since */
+    spin_lock_irqsave(&chardev_lock, flags);
+    if (write_seq == seq && size_of_message == (consumed ? 0 : size) &&
+        read_pos == (consumed ? 0 : start + count)) {
+      size_of_message = size;
+      read_pos = start;
+    } else {
+      consumed = false;
+    }
+    spin_unlock_irqrestore(&chardev_lock, flags);
+    if (consumed) /* the message is pending again */
+      sysfs_notify_dirent(queue_state_kn);
     printk(KERN_INFO "chardev: Failed to send %d characters to the user\n", error_count);
     return -EFAULT; /* Failed -- return a bad address message (i.e. -14) */
   }
 }
 
+/*
+ *  Tops up one rate of a token bucket for elapsed nanoseconds, capped at one
+ * second's worth of tokens
+ */
+static u64 token_fill(u64 tokens, u64 elapsed, unsigned int rate) {
+  u64 burst = (u64)rate * NSEC_PER_SEC;
+
+  if (elapsed >= NSEC_PER_SEC)
+    return burst;
+  return min(tokens + elapsed * rate, burst);
+}
+
+/*
+ *  Byte tokens needed for a write. Writes bigger than one second's worth are
+ * charged a full second so they can still go through.
+ */
+static u64 token_byte_cost(size_t bytes, unsigned int rate) {
+  return (u64)min_t(size_t, bytes, rate) * NSEC_PER_SEC;
+}
+
+/*
+ *  Refills the bucket and returns 0 if it can pay for one message of the
+ * given size, or the number of nanoseconds until it can. Called with the
+ * bucket lock held.
+ */
+static u64 token_deficit(struct token_bucket *tb, u64 now,
+                         unsigned int msg_rate, unsigned int byte_rate,
+                         size_t bytes) {
+  u64 wait = 0, cost;
+
+  tb->msg_tokens = token_fill(tb->msg_tokens, now - tb->last, msg_rate);
+  tb->byte_tokens = token_fill(tb->byte_tokens, now - tb->last, byte_rate);
+  tb->last = now;
+
+  if (msg_rate && tb->msg_tokens < NSEC_PER_SEC)
+    wait = div64_u64(NSEC_PER_SEC - tb->msg_tokens, msg_rate) + 1;
+  if (byte_rate) {
+    cost = token_byte_cost(bytes, byte_rate);
+    if (tb->byte_tokens < cost)
+      wait = max(wait, div64_u64(cost - tb->byte_tokens, byte_rate) + 1);
+  }
+  return wait;
+}
+
+static void token_charge(struct token_bucket *tb, unsigned int msg_rate,
+                         unsigned int byte_rate, size_t bytes) {
+  if (msg_rate)
+    tb->msg_tokens -= NSEC_PER_SEC;
+  if (byte_rate)
+    tb->byte_tokens -= token_byte_cost(bytes, byte_rate);
+}
+
+/*
+ *  Applies the per-file and per-device limits to a write of len bytes. Both
+ * buckets are charged together, or neither is.
+ *  Returns 0 when the write may proceed, -EAGAIN for a non-blocking file that
+ * is over a limit, or -ERESTARTSYS if a signal arrived while waiting.
+ */
+static int dev_throttle(struct file *filep, size_t len) {
+  struct token_bucket *file_bucket = filep->private_data;
+  unsigned int fmsg, fbyte, dmsg, dbyte;
+  u64 file_wait, device_wait, now;
+  bool throttled = false;
+
+  for (;;) {
+    fmsg = READ_ONCE(file_msg_rate);
+    fbyte = READ_ONCE(file_byte_rate);
+    dmsg = READ_ONCE(device_msg_rate);
+    dbyte = READ_ONCE(device_byte_rate);
+    if (!fmsg && !fbyte && !dmsg && !dbyte)
+      return 0; /* no limits configured */
+
+    spin_lock(&file_bucket->lock);
+    spin_lock(&device_bucket.lock);
+    now = ktime_get_ns();
+    file_wait = token_deficit(file_bucket, now, fmsg, fbyte, len);
+    device_wait = token_deficit(&device_bucket, now, dmsg, dbyte, len);
+    if (!file_wait && !device_wait) {
+      token_charge(file_bucket, fmsg, fbyte, len);
+      token_charge(&device_bucket, dmsg, dbyte, len);
+    }
+    spin_unlock(&device_bucket.lock);
+    spin_unlock(&file_bucket->lock);
+
+    if (!file_wait && !device_wait)
+      return 0;
+    if (!throttled) { /* count each write once, however long it waits */
+      throttled = true;
+      atomic_long_inc(device_wait ? &device_throttles : &file_throttles);
+    }
+    if (filep->f_flags & O_NONBLOCK)
+      return -EAGAIN;
+    schedule_timeout_interruptible(
+        nsecs_to_jiffies(max(file_wait, device_wait)) + 1);
+    if (signal_pending(current))
+      return -ERESTARTSYS;
+  }
+}
+
+/*
+ *  Formats a payload into the message slot, or counts it as a repeat of the
+ * pending message when suppress_repeats is set. Never sleeps, so it serves
+ * both dev_write() and chardev_enqueue().
+ *  payload The payload, at least payload_len bytes of kernel memory
+ *  payload_len The number of payload bytes to store
+ *  len The length the producer asked to write, reported in the message
+ */
+static void store_message(const char *payload, size_t payload_len, size_t len) {
+  char suffix[64];
+  int suffix_len;
+  unsigned long flags;
+  bool was_empty;
+  u32 hash;
+
+  hash = jhash(payload, payload_len, 0);
+
+  spin_lock_irqsave(&chardev_lock, flags);
+  was_empty = size_of_message == 0;
+  if (suppress_repeats && !was_empty && read_pos == 0 && hash == message_hash &&
+      payload_len == message_payload_len && len == message_len &&
+      !memcmp(message_payload, payload, payload_len)) {
+    /* same as the pending message -- count it rather than store it again */
+    message_repeats++;
+    suffix_len = scnprintf(suffix, sizeof(suffix),
+                           " (%zu letters, repeated %u times)", len,
+                           message_repeats);
+  } else {
+    memcpy(message_payload, payload, payload_len);
+    message_hash = hash;
+    message_payload_len = payload_len;
+    message_len = len;
+    message_repeats = 1;
+    read_pos = 0;
+    /* appending received string with its length */
+    suffix_len = scnprintf(suffix, sizeof(suffix), " (%zu letters)", len);
+  }
+  /* shorten the payload rather than the suffix so the counts always survive */
+  size_of_message = scnprintf(
+      message, sizeof(message), "%.*s%s",
+      (int)min_t(size_t, payload_len, sizeof(message) - 1 - suffix_len),
+      message_payload, suffix);
+  /* remember where the data was produced */
+  producer_ring[write_seq % PRODUCER_HISTORY] = smp_processor_id();
+  write_seq++;
+  spin_unlock_irqrestore(&chardev_lock, flags);
+  if (was_empty) /* wake monitors polling queue_state */
+    sysfs_notify_dirent(queue_state_kn);
+}
+
 /*
  *  This function is called whenever the device is being written to from user
  * space i.e.
  *  data is sent to the device from the user. The data is copied to the
  * message[] array in this
- *  LKM using the sprintf() function along with the length of the string.
+ *  LKM using the scnprintf() function along with the length of the string.
+ *  With suppress_repeats set, a write identical to the still pending message
+ * only bumps its repeat count, so the reader sees it once with the count.
+ *  Writes over the configured rate limits wait for tokens, or fail with
+ * -EAGAIN when the file is non-blocking.
  *  filep A pointer to a file object
  *  buffer The buffer to that contains the string to write to the device
  *  len The length of the array of data that is being passed in the const char
@@ -155,12 +481,59 @@ static ssize_t dev_read(struct file *filep, char *buffer, size_t len,
  */
 static ssize_t dev_write(struct file *filep, const char *buffer, size_t len,
                          loff_t *offset) {
-  sprintf(message, "%s (%zu letters)", buffer, len); /* appending received string with its length */
-  size_of_message = strlen(message); /* store the length of the stored message */
+  char payload[sizeof(message)];
+  size_t payload_len = min(len, sizeof(payload) - 1);
+  int ret;
+
+  ret = dev_throttle(filep, len);
+  if (ret)
+    return ret; /* -EAGAIN for non-blocking writers, or interrupted */
+
+  if (copy_from_user(payload, buffer, payload_len))
+    return -EFAULT; /* bad address (i.e. -14) */
+
+  store_message(payload, payload_len, len);
   printk(KERN_INFO "chardev: Received %zu characters from the user\n", len);
   return len;
 }
 
+/*
+ *  Push a message into the device from another kernel module. Safe to call
+ * from process, softirq or hardirq context, not NMI: the message goes straight
+ * into the preallocated slot under an irq-safe spinlock and nothing sleeps.
+ * On PREEMPT_RT that spinlock and the one in kernfs_notify() become sleeping
+ * locks, so there it must not be called from hardirq context either.
+ * Kernel producers are not subject to the write rate limits.
+ *  data The message payload; it does not need to be NUL-terminated
+ *  len The length of the payload, truncated to what the slot can hold
+ */
+void chardev_enqueue(const char *data, size_t len) {
+  store_message(data, min(len, sizeof(message) - 1), len);
+}
+EXPORT_SYMBOL_GPL(chardev_enqueue);
+
+/*
+ *  Flush barrier: blocks until every message written to the device before the
+ * call has been consumed by a reader, so a writer knows its data was picked up
+ * without building an acknowledgement channel on top. A message that was
+ * overwritten before anyone read it is released by the read of its successor.
+ *  filep A pointer to a file object
+ *  start, end The byte range to sync -- unused, the whole device is flushed
+ *  datasync Unused
+ */
+static int dev_fsync(struct file *filep, loff_t start, loff_t end,
+                     int datasync) {
+  unsigned long target, flags;
+
+  spin_lock_irqsave(&chardev_lock, flags);
+  target = write_seq;
+  spin_unlock_irqrestore(&chardev_lock, flags);
+
+  /* -ERESTARTSYS if a signal arrives before the barrier is reached */
+  return wait_event_interruptible(flush_wait,
+                                  (long)(READ_ONCE(read_seq) - target) >= 0);
+}
+
 /*
  *  The device release function that is called whenever the device is
  * closed/released by
@@ -169,10 +542,134 @@ static ssize_t dev_write(struct file *filep, const char *buffer, size_t len,
  *  filep A pointer to a file object (defined in linux/fs.h)
  */
 static int dev_release(struct inode *inodep, struct file *filep) {
+  kfree(filep->private_data); /* the per-file token bucket */
   printk(KERN_INFO "chardev: Device successfully closed\n");
   return 0;
 }
 
+/*
+ *  Shows the pending message in sysfs without consuming it. The message stays
+ * in place for the next dev_read().
+ *  dev A pointer to the device the attribute belongs to
+ *  attr A pointer to the attribute being read
+ *  buf The page-sized buffer to fill
+ */
+static ssize_t pending_show(struct device *dev, struct device_attribute *attr,
+                            char *buf) {
+  unsigned long flags;
+  ssize_t ret;
+
+  spin_lock_irqsave(&chardev_lock, flags);
+  ret = scnprintf(buf, PAGE_SIZE, "%.*s\n", size_of_message - read_pos,
+                  message + read_pos);
+  spin_unlock_irqrestore(&chardev_lock, flags);
+  return ret;
+}
+
+/*
+ *  Copies the CPUs of the last PRODUCER_HISTORY messages into cpus and returns
+ * how many there are. Older messages do not count, so the statistics follow a
+ * producer that migrates.
+ */
+static unsigned int producer_history(int *cpus) {
+  unsigned long flags;
+  unsigned int n;
+
+  spin_lock_irqsave(&chardev_lock, flags);
+  n = min_t(unsigned long, write_seq, PRODUCER_HISTORY);
+  memcpy(cpus, producer_ring, sizeof(producer_ring));
+  spin_unlock_irqrestore(&chardev_lock, flags);
+  return n;
+}
+
+/* Counts how many of the n recorded messages were produced on cpu */
+static unsigned int producer_count(const int *cpus, unsigned int n, int cpu) {
+  unsigned int i, count = 0;
+
+  for (i = 0; i < n; i++)
+    count += cpus[i] == cpu;
+  return count;
+}
+
+/*
+ *  Lists how many of the last PRODUCER_HISTORY messages each CPU wrote,
+ * skipping CPUs that wrote none of them. Consumers can use it to pin
+ * themselves next to their producers.
+ */
+static ssize_t producer_cpus_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf) {
+  int cpus[PRODUCER_HISTORY];
+  unsigned int n, count;
+  ssize_t len = 0;
+  int cpu;
+
+  n = producer_history(cpus);
+  for_each_possible_cpu(cpu) {
+    count = producer_count(cpus, n, cpu);
+    if (count)
+      len += scnprintf(buf + len, PAGE_SIZE - len, "%d %u\n", cpu, count);
+  }
+  return len;
+}
+
+/*
+ *  Returns the CPU that wrote the most of the last PRODUCER_HISTORY messages,
+ * or -1 if nothing has been written yet
+ */
+static int busiest_producer_cpu(void) {
+  int cpus[PRODUCER_HISTORY];
+  unsigned int n, count, best_count = 0;
+  int cpu, best_cpu = -1;
+
+  n = producer_history(cpus);
+  for_each_possible_cpu(cpu) {
+    count = producer_count(cpus, n, cpu);
+    if (count > best_count) {
+      best_count = count;
+      best_cpu = cpu;
+    }
+  }
+  return best_cpu;
+}
+
+static ssize_t suggested_cpu_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf) {
+  return scnprintf(buf, PAGE_SIZE, "%d\n", busiest_producer_cpu());
+}
+
+static ssize_t suggested_node_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf) {
+  int cpu = busiest_producer_cpu();
+
+  return scnprintf(buf, PAGE_SIZE, "%d\n", cpu < 0 ? -1 : cpu_to_node(cpu));
+}
+
+/*
+ *  Reports whether a message is waiting to be read. dev_read() and dev_write()
+ * call sysfs_notify_dirent() whenever this changes, so monitors can poll() the file
+ * instead of re-reading it in a loop.
+ */
+static ssize_t queue_state_show(struct device *dev,
+                                struct device_attribute *attr, char *buf) {
+  unsigned long flags;
+  ssize_t ret;
+
+  spin_lock_irqsave(&chardev_lock, flags);
+  ret = scnprintf(buf, PAGE_SIZE, "%s\n", size_of_message ? "pending" : "empty");
+  spin_unlock_irqrestore(&chardev_lock, flags);
+  return ret;
+}
+
+static ssize_t throttled_device_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf) {
+  return scnprintf(buf, PAGE_SIZE, "%ld\n", atomic_long_read(&device_throttles));
+}
+
+static ssize_t throttled_file_show(struct device *dev,
+                                   struct device_attribute *attr, char *buf) {
+  return scnprintf(buf, PAGE_SIZE, "%ld\n", atomic_long_read(&file_throttles));
+}
+
 /*
  * A module must use the module_init() module_exit() macros from linux/init.h,
  * which
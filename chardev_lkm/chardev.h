@@ -0,0 +1,17 @@
+#ifndef CHARDEV_H
+#define CHARDEV_H
+
+#include <linux/types.h>
+
+/*
+ *  In-kernel producer API of the chardev LKM
+ *  chardev_enqueue() stores a message in /dev/chardev the same way a write
+ * from userspace does, except that it is not subject to the device_msg_rate,
+ * device_byte_rate or per-file rate limits. It never sleeps and may be called
+ * from process, softirq or hardirq context, but not from NMI context. On
+ * PREEMPT_RT kernels its spinlocks sleep, so hardirq callers are not safe
+ * there either.
+ */
+void chardev_enqueue(const char *data, size_t len);
+
+#endif /* CHARDEV_H */